@@ -33,6 +33,9 @@
 #define API(returnType) extern "C" returnType
 #endif
 
+typedef void *(*MemoryAllocateCallback)(size_t byteLength, void *userData);
+typedef void (*MemoryFreeCallback)(void *pointer, size_t byteLength, void *userData);
+
 enum ComponentType : size_t
 {
     Byte = 5120,
@@ -18,6 +18,8 @@
  */
 
 #include "decoder.h"
+#include "memory.h"
+#include "optimize.h"
 
 #include <memory>
 #include <vector>
@@ -31,22 +33,117 @@
 
 struct Decoder
 {
-    std::unique_ptr<draco::Mesh> mesh;
-    std::vector<uint8_t> indexBuffer;
-    std::map<uint32_t, std::vector<uint8_t>> buffers;
+    MemoryTracker memory;
+    std::unique_ptr<draco::PointCloud> pointCloud;
+    draco::Mesh *mesh = nullptr;
+    size_t geometryByteLength = 0;
+    TrackedVector<uint8_t> indexBuffer{TrackedAllocator<uint8_t>(&memory)};
+    TrackedMap<uint32_t, TrackedVector<uint8_t>> buffers{TrackedAllocator<std::pair<const uint32_t, TrackedVector<uint8_t>>>(&memory)};
     draco::DecoderBuffer decoderBuffer;
-    uint32_t vertexCount;
-    uint32_t indexCount;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    uint32_t vertexCacheSize = 0;
+    float originalACMR = 0.0f;
+    float optimizedACMR = 0.0f;
+    TrackedVector<uint32_t> optimizedIndices{TrackedAllocator<uint32_t>(&memory)};
+    TrackedVector<uint32_t> vertexOrder{TrackedAllocator<uint32_t>(&memory)};
+
+    explicit Decoder(const MemoryCallbacks &callbacks) : memory(callbacks) {}
 };
 
 Decoder *decoderCreate()
 {
-    return new Decoder;
+    return decoderCreateWithAllocator(nullptr, nullptr, nullptr);
+}
+
+Decoder *decoderCreateWithAllocator(MemoryAllocateCallback allocate, MemoryFreeCallback free, void *userData)
+{
+    Decoder *decoder = createTracked<Decoder>(makeMemoryCallbacks(allocate, free, userData));
+    if (decoder == nullptr)
+    {
+        printf(LOG_PREFIX "Out of memory while creating decoder\n");
+    }
+    return decoder;
 }
 
 void decoderRelease(Decoder *decoder)
 {
-    delete decoder;
+    releaseTracked(decoder);
+}
+
+void decoderSetMemoryLimit(Decoder *decoder, size_t byteLength)
+{
+    decoder->memory.limitBytes = byteLength;
+}
+
+size_t decoderGetMemoryUsage(Decoder *decoder)
+{
+    return decoder->memory.currentBytes;
+}
+
+size_t decoderGetPeakMemoryUsage(Decoder *decoder)
+{
+    return decoder->memory.peakBytes;
+}
+
+size_t getGeometryByteLength(const draco::PointCloud &pointCloud, const draco::Mesh *mesh)
+{
+    size_t byteLength = 0;
+    for (int32_t i = 0; i < pointCloud.num_attributes(); ++i)
+    {
+        byteLength += pointCloud.attribute(i)->buffer()->data_size();
+    }
+    if (mesh != nullptr)
+    {
+        byteLength += mesh->num_faces() * sizeof(draco::Mesh::Face);
+    }
+    return byteLength;
+}
+
+void releaseDecodedData(Decoder *decoder)
+{
+    // Swapping with empty containers returns the capacity to the allocator, clear() would keep it counted.
+    decoder->buffers.clear();
+    TrackedVector<uint8_t>(TrackedAllocator<uint8_t>(&decoder->memory)).swap(decoder->indexBuffer);
+    TrackedVector<uint32_t>(TrackedAllocator<uint32_t>(&decoder->memory)).swap(decoder->optimizedIndices);
+    TrackedVector<uint32_t>(TrackedAllocator<uint32_t>(&decoder->memory)).swap(decoder->vertexOrder);
+}
+
+void decoderSetVertexCacheSize(Decoder *decoder, uint32_t vertexCacheSize)
+{
+    decoder->vertexCacheSize = vertexCacheSize;
+}
+
+void optimizeIndices(Decoder *decoder)
+{
+    TrackedVector<uint32_t> indices(TrackedAllocator<uint32_t>(&decoder->memory));
+    indices.reserve(decoder->indexCount);
+
+    for (uint32_t faceIndex = 0; faceIndex < decoder->mesh->num_faces(); ++faceIndex)
+    {
+        const draco::Mesh::Face &face = decoder->mesh->face(draco::FaceIndex(faceIndex));
+        indices.push_back(face[0].value());
+        indices.push_back(face[1].value());
+        indices.push_back(face[2].value());
+    }
+
+    for (uint32_t index : indices)
+    {
+        if (index >= decoder->vertexCount)
+        {
+            printf(LOG_PREFIX "Skipping index optimization, index %" PRIu32 " is out of range\n", index);
+            return;
+        }
+    }
+
+    decoder->originalACMR = computeACMR(indices, decoder->vertexCount, decoder->vertexCacheSize);
+
+    indices = optimizeVertexCache(indices, decoder->vertexCount, decoder->vertexCacheSize);
+    decoder->vertexOrder = optimizeVertexFetch(indices, decoder->vertexCount);
+    decoder->optimizedACMR = computeACMR(indices, decoder->vertexCount, decoder->vertexCacheSize);
+    decoder->optimizedIndices = std::move(indices);
+
+    printf(LOG_PREFIX "ACMR with cache size %" PRIu32 ": %.3f before, %.3f after optimization\n", decoder->vertexCacheSize, decoder->originalACMR, decoder->optimizedACMR);
 }
 
 bool decoderDecode(Decoder *decoder, void *data, size_t byteLength)
@@ -55,19 +152,82 @@ bool decoderDecode(Decoder *decoder, void *data, size_t byteLength)
     draco::DecoderBuffer dracoDecoderBuffer;
     dracoDecoderBuffer.Init(reinterpret_cast<char *>(data), byteLength);
 
-    auto decoderStatus = dracoDecoder.DecodeMeshFromBuffer(&dracoDecoderBuffer);
-    if (!decoderStatus.ok())
+    auto geometryType = draco::Decoder::GetEncodedGeometryType(&dracoDecoderBuffer);
+    if (!geometryType.ok())
     {
-        printf(LOG_PREFIX "Error during Draco decoding: %s\n", decoderStatus.status().error_msg());
+        printf(LOG_PREFIX "Error during Draco decoding: %s\n", geometryType.status().error_msg());
         return false;
     }
 
-    decoder->mesh = std::move(decoderStatus).value();
-    decoder->vertexCount = decoder->mesh->num_points();
-    decoder->indexCount = decoder->mesh->num_faces() * 3;
+    // Decode into locals so a failure leaves the previously decoded geometry intact.
+    std::unique_ptr<draco::PointCloud> pointCloud;
+    draco::Mesh *mesh = nullptr;
+
+    if (geometryType.value() == draco::POINT_CLOUD)
+    {
+        auto decoderStatus = dracoDecoder.DecodePointCloudFromBuffer(&dracoDecoderBuffer);
+        if (!decoderStatus.ok())
+        {
+            printf(LOG_PREFIX "Error during Draco decoding: %s\n", decoderStatus.status().error_msg());
+            return false;
+        }
+
+        pointCloud = std::move(decoderStatus).value();
+    }
+    else
+    {
+        auto decoderStatus = dracoDecoder.DecodeMeshFromBuffer(&dracoDecoderBuffer);
+        if (!decoderStatus.ok())
+        {
+            printf(LOG_PREFIX "Error during Draco decoding: %s\n", decoderStatus.status().error_msg());
+            return false;
+        }
+
+        std::unique_ptr<draco::Mesh> decodedMesh = std::move(decoderStatus).value();
+        mesh = decodedMesh.get();
+        pointCloud = std::move(decodedMesh);
+    }
+
+    // Draco allocates the decoded geometry itself, so it is only accounted for. The previous geometry
+    // is still alive at this point and is released from the counters afterwards.
+    size_t geometryByteLength = getGeometryByteLength(*pointCloud, mesh);
+    if (!decoder->memory.track(geometryByteLength))
+    {
+        printf(LOG_PREFIX "Memory limit exceeded by %zu bytes of decoded geometry\n", geometryByteLength);
+        return false;
+    }
+    decoder->memory.untrack(decoder->geometryByteLength);
+    decoder->geometryByteLength = geometryByteLength;
+
+    // Attributes and indices read from the previous geometry are stale now.
+    releaseDecodedData(decoder);
+    decoder->pointCloud = std::move(pointCloud);
+    decoder->mesh = mesh;
+    decoder->vertexCount = decoder->pointCloud->num_points();
+    decoder->indexCount = decoder->mesh != nullptr ? decoder->mesh->num_faces() * 3 : 0;
 
     printf(LOG_PREFIX "Decoded %" PRIu32 " vertices, %" PRIu32 " indices\n", decoder->vertexCount, decoder->indexCount);
 
+    decoder->originalACMR = 0.0f;
+    decoder->optimizedACMR = 0.0f;
+
+    if (decoder->vertexCacheSize > 0 && decoder->mesh != nullptr)
+    {
+        try
+        {
+            optimizeIndices(decoder);
+        }
+        catch (const std::bad_alloc &)
+        {
+            // The pass is optional, so hitting the memory limit here keeps the committed geometry in Draco order.
+            printf(LOG_PREFIX "Memory limit exceeded or out of memory during index optimization, keeping decoded order\n");
+            TrackedVector<uint32_t>(TrackedAllocator<uint32_t>(&decoder->memory)).swap(decoder->optimizedIndices);
+            TrackedVector<uint32_t>(TrackedAllocator<uint32_t>(&decoder->memory)).swap(decoder->vertexOrder);
+            decoder->originalACMR = 0.0f;
+            decoder->optimizedACMR = 0.0f;
+        }
+    }
+
     return true;
 }
 
@@ -81,15 +241,30 @@ uint32_t decoderGetIndexCount(Decoder *decoder)
     return decoder->indexCount;
 }
 
+bool decoderIsPointCloud(Decoder *decoder)
+{
+    return decoder->pointCloud != nullptr && decoder->mesh == nullptr;
+}
+
+float decoderGetOriginalACMR(Decoder *decoder)
+{
+    return decoder->originalACMR;
+}
+
+float decoderGetOptimizedACMR(Decoder *decoder)
+{
+    return decoder->optimizedACMR;
+}
+
 bool decoderAttributeIsNormalized(Decoder *decoder, uint32_t id)
 {
-    const draco::PointAttribute *attribute = decoder->mesh->GetAttributeByUniqueId(id);
+    const draco::PointAttribute *attribute = decoder->pointCloud->GetAttributeByUniqueId(id);
     return attribute != nullptr && attribute->normalized();
 }
 
 bool decoderReadAttribute(Decoder *decoder, uint32_t id, size_t componentType, char *dataType)
 {
-    const draco::PointAttribute *attribute = decoder->mesh->GetAttributeByUniqueId(id);
+    const draco::PointAttribute *attribute = decoder->pointCloud->GetAttributeByUniqueId(id);
 
     if (attribute == nullptr)
     {
@@ -99,12 +274,22 @@ bool decoderReadAttribute(Decoder *decoder, uint32_t id, size_t componentType, c
 
     size_t stride = getAttributeStride(componentType, dataType);
 
-    std::vector<uint8_t> decodedData;
-    decodedData.resize(stride * decoder->vertexCount);
+    TrackedVector<uint8_t> decodedData(TrackedAllocator<uint8_t>(&decoder->memory));
+
+    try
+    {
+        decodedData.resize(stride * decoder->vertexCount);
+    }
+    catch (const std::bad_alloc &)
+    {
+        printf(LOG_PREFIX "Out of memory while reading attribute with id=%" PRIu32 "\n", id);
+        return false;
+    }
 
     for (uint32_t i = 0; i < decoder->vertexCount; ++i)
     {
-        auto index = attribute->mapped_index(draco::PointIndex(i));
+        uint32_t pointIndex = decoder->vertexOrder.empty() ? i : decoder->vertexOrder[i];
+        auto index = attribute->mapped_index(draco::PointIndex(pointIndex));
         uint8_t *value = decodedData.data() + i * stride;
 
         bool converted = false;
@@ -140,7 +325,15 @@ bool decoderReadAttribute(Decoder *decoder, uint32_t id, size_t componentType, c
         }
     }
 
-    decoder->buffers[id] = decodedData;
+    try
+    {
+        decoder->buffers.insert_or_assign(id, std::move(decodedData));
+    }
+    catch (const std::bad_alloc &)
+    {
+        printf(LOG_PREFIX "Out of memory while reading attribute with id=%" PRIu32 "\n", id);
+        return false;
+    }
     return true;
 }
 
@@ -169,10 +362,21 @@ void decoderCopyAttribute(Decoder *decoder, size_t id, void *output)
 template <class T>
 void decodeIndices(Decoder *decoder)
 {
-    std::vector<uint8_t> decodedIndices;
+    TrackedVector<uint8_t> decodedIndices(TrackedAllocator<uint8_t>(&decoder->memory));
     decodedIndices.resize(decoder->indexCount * sizeof(T));
     T *typedView = reinterpret_cast<T *>(decodedIndices.data());
 
+    if (!decoder->optimizedIndices.empty())
+    {
+        for (uint32_t i = 0; i < decoder->indexCount; ++i)
+        {
+            typedView[i] = static_cast<T>(decoder->optimizedIndices[i]);
+        }
+
+        decoder->indexBuffer = std::move(decodedIndices);
+        return;
+    }
+
     for (uint32_t faceIndex = 0; faceIndex < decoder->mesh->num_faces(); ++faceIndex)
     {
         const draco::Mesh::Face &face = decoder->mesh->face(draco::FaceIndex(faceIndex));
@@ -181,30 +385,44 @@ void decodeIndices(Decoder *decoder)
         typedView[faceIndex * 3 + 2] = face[2].value();
     }
 
-    decoder->indexBuffer = decodedIndices;
+    decoder->indexBuffer = std::move(decodedIndices);
 }
 
 bool decoderReadIndices(Decoder *decoder, size_t indexComponentType)
 {
-    switch (indexComponentType)
-    {
-    case ComponentType::Byte:
-        decodeIndices<int8_t>(decoder);
-        break;
-    case ComponentType::UnsignedByte:
-        decodeIndices<uint8_t>(decoder);
-        break;
-    case ComponentType::Short:
-        decodeIndices<int16_t>(decoder);
-        break;
-    case ComponentType::UnsignedShort:
-        decodeIndices<uint16_t>(decoder);
-        break;
-    case ComponentType::UnsignedInt:
-        decodeIndices<uint32_t>(decoder);
-        break;
-    default:
-        printf(LOG_PREFIX "Index component type %zu not supported\n", indexComponentType);
+    if (decoder->mesh == nullptr)
+    {
+        printf(LOG_PREFIX "Draco data is a point cloud without indices\n");
+        return false;
+    }
+
+    try
+    {
+        switch (indexComponentType)
+        {
+        case ComponentType::Byte:
+            decodeIndices<int8_t>(decoder);
+            break;
+        case ComponentType::UnsignedByte:
+            decodeIndices<uint8_t>(decoder);
+            break;
+        case ComponentType::Short:
+            decodeIndices<int16_t>(decoder);
+            break;
+        case ComponentType::UnsignedShort:
+            decodeIndices<uint16_t>(decoder);
+            break;
+        case ComponentType::UnsignedInt:
+            decodeIndices<uint32_t>(decoder);
+            break;
+        default:
+            printf(LOG_PREFIX "Index component type %zu not supported\n", indexComponentType);
+            return false;
+        }
+    }
+    catch (const std::bad_alloc &)
+    {
+        printf(LOG_PREFIX "Out of memory while reading indices\n");
         return false;
     }
 
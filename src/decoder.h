@@ -31,9 +31,41 @@ struct Decoder;
 API(Decoder *)
 decoderCreate();
 
+/**
+ * Like decoderCreate, but all memory owned by the decoder is allocated through the given callbacks.
+ * Returned memory must be suitably aligned for any fundamental type. Null callbacks select malloc/free.
+ */
+API(Decoder *)
+decoderCreateWithAllocator(MemoryAllocateCallback allocate, MemoryFreeCallback free, void *userData);
+
 API(void)
 decoderRelease(Decoder *decoder);
 
+/**
+ * Enables reordering of decoded triangles and vertices for a post-transform cache of the given size.
+ * The size drives both the reordering (clamped to 4..64 entries) and the reported ACMR. 0 disables the pass.
+ */
+API(void)
+decoderSetVertexCacheSize(Decoder *decoder, uint32_t vertexCacheSize);
+
+/**
+ * Limits the bytes counted for this decoder, including the geometry allocated by Draco itself.
+ * Calls that would exceed the limit fail. 0 removes the limit. The decoded geometry is only checked after
+ * Draco has allocated it, so decoding can briefly exceed the limit before it fails. Temporaries inside the
+ * Draco decoder are not counted. If the limit is hit during index optimization, the decoded order is kept.
+ */
+API(void)
+decoderSetMemoryLimit(Decoder *decoder, size_t byteLength);
+
+API(size_t)
+decoderGetMemoryUsage(Decoder *decoder);
+
+/**
+ * Peak of the counted bytes. Excludes temporaries inside the Draco decoder, so the real high-water mark is higher.
+ */
+API(size_t)
+decoderGetPeakMemoryUsage(Decoder *decoder);
+
 API(bool)
 decoderDecode(Decoder *decoder, void *data, size_t byteLength);
 
@@ -43,6 +75,15 @@ decoderGetVertexCount(Decoder *decoder);
 API(uint32_t)
 decoderGetIndexCount(Decoder *decoder);
 
+API(bool)
+decoderIsPointCloud(Decoder *decoder);
+
+API(float)
+decoderGetOriginalACMR(Decoder *decoder);
+
+API(float)
+decoderGetOptimizedACMR(Decoder *decoder);
+
 API(bool)
 decoderAttributeIsNormalized(Decoder *decoder, uint32_t id);
 
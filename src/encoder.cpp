@@ -18,6 +18,7 @@
  */
 
 #include "encoder.h"
+#include "memory.h"
 
 #include <memory>
 #include <vector>
@@ -30,10 +31,11 @@
 
 struct Encoder
 {
+    MemoryTracker memory;
     draco::Mesh mesh;
     uint32_t encodedVertices;
     uint32_t encodedIndices;
-    std::vector<std::unique_ptr<draco::DataBuffer>> buffers;
+    TrackedVector<std::unique_ptr<draco::DataBuffer>> buffers{TrackedAllocator<std::unique_ptr<draco::DataBuffer>>(&memory)};
     draco::EncoderBuffer encoderBuffer;
     uint32_t compressionLevel = 7;
     size_t rawSize = 0;
@@ -45,18 +47,46 @@ struct Encoder
         uint32_t color = 10;
         uint32_t generic = 12;
     } quantization;
+
+    explicit Encoder(const MemoryCallbacks &callbacks) : memory(callbacks) {}
 };
 
 Encoder *encoderCreate(uint32_t vertexCount)
 {
-    Encoder *encoder = new Encoder;
+    return encoderCreateWithAllocator(vertexCount, nullptr, nullptr, nullptr);
+}
+
+Encoder *encoderCreateWithAllocator(uint32_t vertexCount, MemoryAllocateCallback allocate, MemoryFreeCallback free, void *userData)
+{
+    Encoder *encoder = createTracked<Encoder>(makeMemoryCallbacks(allocate, free, userData));
+    if (encoder == nullptr)
+    {
+        printf(LOG_PREFIX "Out of memory while creating encoder\n");
+        return nullptr;
+    }
+
     encoder->mesh.set_num_points(vertexCount);
     return encoder;
 }
 
 void encoderRelease(Encoder *encoder)
 {
-    delete encoder;
+    releaseTracked(encoder);
+}
+
+void encoderSetMemoryLimit(Encoder *encoder, size_t byteLength)
+{
+    encoder->memory.limitBytes = byteLength;
+}
+
+size_t encoderGetMemoryUsage(Encoder *encoder)
+{
+    return encoder->memory.currentBytes;
+}
+
+size_t encoderGetPeakMemoryUsage(Encoder *encoder)
+{
+    return encoder->memory.peakBytes;
 }
 
 void encoderSetCompressionLevel(Encoder *encoder, uint32_t compressionLevel)
@@ -73,12 +103,8 @@ void encoderSetQuantizationBits(Encoder *encoder, uint32_t position, uint32_t no
     encoder->quantization.generic = generic;
 }
 
-bool encoderEncode(Encoder *encoder, uint8_t preserveTriangleOrder)
+void configureEncoder(Encoder *encoder, draco::Encoder &dracoEncoder)
 {
-    printf(LOG_PREFIX "Preserve triangle order: %s\n", preserveTriangleOrder ? "yes" : "no");
-
-    draco::Encoder dracoEncoder;
-
     int speed = 10 - static_cast<int>(encoder->compressionLevel);
     dracoEncoder.SetSpeedOptions(speed, speed);
 
@@ -88,27 +114,112 @@ bool encoderEncode(Encoder *encoder, uint8_t preserveTriangleOrder)
     dracoEncoder.SetAttributeQuantization(draco::GeometryAttribute::COLOR, encoder->quantization.color);
     dracoEncoder.SetAttributeQuantization(draco::GeometryAttribute::GENERIC, encoder->quantization.generic);
     dracoEncoder.SetTrackEncodedProperties(true);
+}
+
+bool finishEncoding(Encoder *encoder, draco::Encoder &dracoEncoder, const draco::Status &encoderStatus, size_t previousByteLength)
+{
+    if (!encoderStatus.ok())
+    {
+        // Drop partial output so it neither reaches encoderCopy nor counts against the limit.
+        encoder->encoderBuffer.Resize(static_cast<int64_t>(previousByteLength));
+        printf(LOG_PREFIX "Error during Draco encoding: %s\n", encoderStatus.error_msg());
+        return false;
+    }
+
+    // Draco appends to the encoder buffer, so only the newly written bytes are accounted for.
+    size_t encodedByteLength = encoder->encoderBuffer.size() - previousByteLength;
+    if (!encoder->memory.track(encodedByteLength))
+    {
+        encoder->encoderBuffer.Resize(static_cast<int64_t>(previousByteLength));
+        printf(LOG_PREFIX "Memory limit exceeded by %zu bytes of encoded data\n", encodedByteLength);
+        return false;
+    }
+
+    encoder->encodedVertices = static_cast<uint32_t>(dracoEncoder.num_encoded_points());
+    encoder->encodedIndices = static_cast<uint32_t>(dracoEncoder.num_encoded_faces() * 3);
+    size_t encodedSize = encoder->encoderBuffer.size();
+    float compressionRatio = static_cast<float>(encoder->rawSize) / static_cast<float>(encodedSize);
+    printf(LOG_PREFIX "Encoded %" PRIu32 " vertices, %" PRIu32 " indices, raw size: %zu, encoded size: %zu, compression ratio: %.2f\n", encoder->encodedVertices, encoder->encodedIndices, encoder->rawSize, encodedSize, compressionRatio);
+    return true;
+}
+
+bool encoderEncode(Encoder *encoder, uint8_t preserveTriangleOrder)
+{
+    printf(LOG_PREFIX "Preserve triangle order: %s\n", preserveTriangleOrder ? "yes" : "no");
+
+    draco::Encoder dracoEncoder;
+    configureEncoder(encoder, dracoEncoder);
 
     if (preserveTriangleOrder)
     {
         dracoEncoder.SetEncodingMethod(draco::MESH_SEQUENTIAL_ENCODING);
     }
 
+    size_t previousByteLength = encoder->encoderBuffer.size();
     auto encoderStatus = dracoEncoder.EncodeMeshToBuffer(encoder->mesh, &encoder->encoderBuffer);
-    if (encoderStatus.ok())
+    return finishEncoding(encoder, dracoEncoder, encoderStatus, previousByteLength);
+}
+
+uint32_t getQuantizationBits(Encoder *encoder, draco::GeometryAttribute::Type semantics)
+{
+    switch (semantics)
     {
-        encoder->encodedVertices = static_cast<uint32_t>(dracoEncoder.num_encoded_points());
-        encoder->encodedIndices = static_cast<uint32_t>(dracoEncoder.num_encoded_faces() * 3);
-        size_t encodedSize = encoder->encoderBuffer.size();
-        float compressionRatio = static_cast<float>(encoder->rawSize) / static_cast<float>(encodedSize);
-        printf(LOG_PREFIX "Encoded %" PRIu32 " vertices, %" PRIu32 " indices, raw size: %zu, encoded size: %zu, compression ratio: %.2f\n", encoder->encodedVertices, encoder->encodedIndices, encoder->rawSize, encodedSize, compressionRatio);
-        return true;
+    case draco::GeometryAttribute::POSITION:
+        return encoder->quantization.position;
+    case draco::GeometryAttribute::NORMAL:
+        return encoder->quantization.normal;
+    case draco::GeometryAttribute::TEX_COORD:
+        return encoder->quantization.uv;
+    case draco::GeometryAttribute::COLOR:
+        return encoder->quantization.color;
+    default:
+        return encoder->quantization.generic;
     }
-    else
+}
+
+bool supportsKdTreeEncoding(Encoder *encoder)
+{
+    for (int32_t i = 0; i < encoder->mesh.num_attributes(); ++i)
     {
-        printf(LOG_PREFIX "Error during Draco encoding: %s\n", encoderStatus.error_msg());
-        return false;
+        const draco::PointAttribute *attribute = encoder->mesh.attribute(i);
+
+        switch (attribute->data_type())
+        {
+        case draco::DataType::DT_INT8:
+        case draco::DataType::DT_UINT8:
+        case draco::DataType::DT_INT16:
+        case draco::DataType::DT_UINT16:
+        case draco::DataType::DT_INT32:
+        case draco::DataType::DT_UINT32:
+            break;
+        case draco::DataType::DT_FLOAT32:
+            if (getQuantizationBits(encoder, attribute->attribute_type()) == 0)
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
     }
+
+    return true;
+}
+
+bool encoderEncodePointCloud(Encoder *encoder)
+{
+    draco::Encoder dracoEncoder;
+    configureEncoder(encoder, dracoEncoder);
+
+    // Draco would use the sequential encoder at speed 10, so the kd-tree is requested explicitly.
+    bool kdTree = supportsKdTreeEncoding(encoder);
+    dracoEncoder.SetEncodingMethod(kdTree ? draco::POINT_CLOUD_KD_TREE_ENCODING : draco::POINT_CLOUD_SEQUENTIAL_ENCODING);
+    printf(LOG_PREFIX "Point cloud encoding: %s\n", kdTree ? "kd-tree" : "sequential");
+
+    const draco::PointCloud &pointCloud = encoder->mesh;
+    size_t previousByteLength = encoder->encoderBuffer.size();
+    auto encoderStatus = dracoEncoder.EncodePointCloudToBuffer(pointCloud, &encoder->encoderBuffer);
+    return finishEncoding(encoder, dracoEncoder, encoderStatus, previousByteLength);
 }
 
 uint32_t encoderGetEncodedVertexCount(Encoder *encoder)
@@ -132,9 +243,17 @@ void encoderCopy(Encoder *encoder, uint8_t *data)
 }
 
 template <class T>
-void encodeIndices(Encoder *encoder, uint32_t indexCount, T *indices)
+bool encodeIndices(Encoder *encoder, uint32_t indexCount, T *indices)
 {
     int face_count = indexCount / 3;
+
+    // Faces are stored by Draco itself, so they are only accounted for.
+    if (!encoder->memory.track(face_count * sizeof(draco::Mesh::Face)))
+    {
+        printf(LOG_PREFIX "Memory limit exceeded by %d faces\n", face_count);
+        return false;
+    }
+    encoder->memory.untrack(encoder->mesh.num_faces() * sizeof(draco::Mesh::Face));
     encoder->mesh.SetNumFaces(static_cast<size_t>(face_count));
     encoder->rawSize += indexCount * sizeof(T);
 
@@ -146,29 +265,27 @@ void encodeIndices(Encoder *encoder, uint32_t indexCount, T *indices)
             draco::PointIndex(indices[3 * i + 2])};
         encoder->mesh.SetFace(draco::FaceIndex(static_cast<uint32_t>(i)), face);
     }
+
+    return true;
 }
 
-void encoderSetIndices(Encoder *encoder, size_t indexComponentType, uint32_t indexCount, void *indices)
+bool encoderSetIndices(Encoder *encoder, size_t indexComponentType, uint32_t indexCount, void *indices)
 {
     switch (indexComponentType)
     {
     case ComponentType::Byte:
-        encodeIndices(encoder, indexCount, reinterpret_cast<int8_t *>(indices));
-        break;
+        return encodeIndices(encoder, indexCount, reinterpret_cast<int8_t *>(indices));
     case ComponentType::UnsignedByte:
-        encodeIndices(encoder, indexCount, reinterpret_cast<uint8_t *>(indices));
-        break;
+        return encodeIndices(encoder, indexCount, reinterpret_cast<uint8_t *>(indices));
     case ComponentType::Short:
-        encodeIndices(encoder, indexCount, reinterpret_cast<int16_t *>(indices));
-        break;
+        return encodeIndices(encoder, indexCount, reinterpret_cast<int16_t *>(indices));
     case ComponentType::UnsignedShort:
-        encodeIndices(encoder, indexCount, reinterpret_cast<uint16_t *>(indices));
-        break;
+        return encodeIndices(encoder, indexCount, reinterpret_cast<uint16_t *>(indices));
     case ComponentType::UnsignedInt:
-        encodeIndices(encoder, indexCount, reinterpret_cast<uint32_t *>(indices));
-        break;
+        return encodeIndices(encoder, indexCount, reinterpret_cast<uint32_t *>(indices));
     default:
         printf(LOG_PREFIX "Index component type %zu not supported\n", indexComponentType);
+        return false;
     }
 }
 
@@ -224,15 +341,34 @@ draco::DataType getDataType(size_t componentType)
 API(uint32_t)
 encoderSetAttribute(Encoder *encoder, char *attributeName, size_t componentType, char *dataType, void *data)
 {
-    auto buffer = std::make_unique<draco::DataBuffer>();
     uint32_t count = encoder->mesh.num_points();
     size_t componentCount = getNumberOfComponents(dataType);
     size_t stride = getAttributeStride(componentType, dataType);
     draco::DataType dracoDataType = getDataType(componentType);
 
+    // The attribute values are copied into storage owned by Draco, so they are only accounted for.
+    if (!encoder->memory.track(count * stride))
+    {
+        printf(LOG_PREFIX "Memory limit exceeded while setting attribute %s\n", attributeName);
+        return static_cast<uint32_t>(-1);
+    }
+
+    try
+    {
+        encoder->buffers.emplace_back(std::make_unique<draco::DataBuffer>());
+    }
+    catch (const std::bad_alloc &)
+    {
+        encoder->memory.untrack(count * stride);
+        printf(LOG_PREFIX "Out of memory while setting attribute %s\n", attributeName);
+        return static_cast<uint32_t>(-1);
+    }
+
+    draco::DataBuffer *buffer = encoder->buffers.back().get();
+
     draco::GeometryAttribute::Type semantics = getAttributeSemantics(attributeName);
     draco::GeometryAttribute attribute;
-    attribute.Init(semantics, &*buffer, componentCount, getDataType(componentType), false, stride, 0);
+    attribute.Init(semantics, buffer, componentCount, getDataType(componentType), false, stride, 0);
 
     auto id = static_cast<uint32_t>(encoder->mesh.AddAttribute(attribute, true, count));
     auto dataBytes = reinterpret_cast<uint8_t *>(data);
@@ -242,7 +378,6 @@ encoderSetAttribute(Encoder *encoder, char *attributeName, size_t componentType,
         encoder->mesh.attribute(id)->SetAttributeValue(draco::AttributeValueIndex(i), dataBytes + i * stride);
     }
 
-    encoder->buffers.emplace_back(std::move(buffer));
     encoder->rawSize += count * stride;
     return id;
 }
@@ -31,9 +31,34 @@ struct Encoder;
 API(Encoder *)
 encoderCreate(uint32_t vertexCount);
 
+/**
+ * Like encoderCreate, but all memory owned by the encoder is allocated through the given callbacks.
+ * Returned memory must be suitably aligned for any fundamental type. Null callbacks select malloc/free.
+ */
+API(Encoder *)
+encoderCreateWithAllocator(uint32_t vertexCount, MemoryAllocateCallback allocate, MemoryFreeCallback free, void *userData);
+
 API(void)
 encoderRelease(Encoder *encoder);
 
+/**
+ * Limits the bytes counted for this encoder, including attributes, faces and encoded data stored by Draco itself.
+ * Calls that would exceed the limit fail. 0 removes the limit. Attributes and faces are checked before Draco
+ * allocates them, but the encoded data is only checked once Draco has written it, so encoding can briefly
+ * exceed the limit before it fails. Temporaries inside the Draco encoder are not counted.
+ */
+API(void)
+encoderSetMemoryLimit(Encoder *encoder, size_t byteLength);
+
+API(size_t)
+encoderGetMemoryUsage(Encoder *encoder);
+
+/**
+ * Peak of the counted bytes. Excludes temporaries inside the Draco encoder, so the real high-water mark is higher.
+ */
+API(size_t)
+encoderGetPeakMemoryUsage(Encoder *encoder);
+
 API(void)
 encoderSetCompressionLevel(Encoder *encoder, uint32_t compressionLevel);
 
@@ -43,15 +68,28 @@ encoderSetQuantizationBits(Encoder *encoder, uint32_t position, uint32_t normal,
 API(bool)
 encoderEncode(Encoder *encoder, uint8_t preserveTriangleOrder);
 
+/**
+ * Encodes the attributes as a point cloud, ignoring any indices. Uses the kd-tree encoder if every attribute
+ * is an integer type or a float with non-zero quantization bits, and the sequential encoder otherwise.
+ */
+API(bool)
+encoderEncodePointCloud(Encoder *encoder);
+
 API(uint64_t)
 encoderGetByteLength(Encoder *encoder);
 
 API(void)
 encoderCopy(Encoder *encoder, uint8_t *data);
 
-API(void)
+/**
+ * Returns false if the index type is not supported or the memory limit would be exceeded.
+ */
+API(bool)
 encoderSetIndices(Encoder *encoder, size_t indexComponentType, uint32_t indexCount, void *indices);
 
+/**
+ * Returns the id of the new attribute, or UINT32_MAX if it could not be added, e.g. because the memory limit would be exceeded.
+ */
 API(uint32_t)
 encoderSetAttribute(Encoder *encoder, char *attributeName, size_t componentType, char *dataType, void *data);
 
@@ -0,0 +1,91 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory.h"
+
+#include <cstdlib>
+
+namespace
+{
+    void *defaultAllocate(size_t byteLength, void *)
+    {
+        return malloc(byteLength);
+    }
+
+    void defaultFree(void *pointer, size_t, void *)
+    {
+        free(pointer);
+    }
+}
+
+MemoryCallbacks getDefaultMemoryCallbacks()
+{
+    return {defaultAllocate, defaultFree, nullptr};
+}
+
+MemoryCallbacks makeMemoryCallbacks(MemoryAllocateCallback allocate, MemoryFreeCallback free, void *userData)
+{
+    if (allocate == nullptr || free == nullptr)
+    {
+        return getDefaultMemoryCallbacks();
+    }
+
+    return {allocate, free, userData};
+}
+
+MemoryTracker::MemoryTracker(const MemoryCallbacks &callbacks)
+    : callbacks(callbacks)
+{
+}
+
+void *MemoryTracker::allocate(size_t byteLength)
+{
+    if (!track(byteLength))
+    {
+        return nullptr;
+    }
+
+    void *pointer = callbacks.allocate(byteLength, callbacks.userData);
+    if (pointer == nullptr)
+    {
+        untrack(byteLength);
+    }
+    return pointer;
+}
+
+void MemoryTracker::deallocate(void *pointer, size_t byteLength)
+{
+    callbacks.free(pointer, byteLength, callbacks.userData);
+    untrack(byteLength);
+}
+
+bool MemoryTracker::track(size_t byteLength)
+{
+    if (limitBytes != 0 && (currentBytes > limitBytes || byteLength > limitBytes - currentBytes))
+    {
+        return false;
+    }
+
+    currentBytes += byteLength;
+    if (currentBytes > peakBytes)
+    {
+        peakBytes = currentBytes;
+    }
+    return true;
+}
+
+void MemoryTracker::untrack(size_t byteLength)
+{
+    currentBytes -= byteLength < currentBytes ? byteLength : currentBytes;
+}
@@ -0,0 +1,162 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host-supplied allocation callbacks and per-object memory accounting.
+ *
+ * Each encoder and decoder owns a MemoryTracker holding the callbacks it was created with, so
+ * concurrent objects never share allocator state. Buffers owned by this library go through the
+ * callbacks. Memory owned by Draco itself (mesh attributes, faces, decoded geometry, the encoded
+ * output) still comes from the global heap; it is only counted, but counts against the limit.
+ *
+ * Caveats for sizing jobs: decoded geometry and encoded output are only known, and checked against
+ * the limit, after Draco has allocated them, so the limit can be overshot by that amount before the
+ * call fails. Temporaries inside draco::Encoder and draco::Decoder (Edgebreaker and kd-tree state,
+ * attribute transform buffers) are never counted, so the real high-water mark is above the peak.
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <map>
+#include <new>
+#include <vector>
+
+struct MemoryCallbacks
+{
+    MemoryAllocateCallback allocate;
+    MemoryFreeCallback free;
+    void *userData;
+};
+
+/**
+ * Callbacks backed by malloc/free, used when the host does not supply any.
+ */
+MemoryCallbacks getDefaultMemoryCallbacks();
+
+/**
+ * Returns the given callbacks, or the default ones if either callback is null.
+ */
+MemoryCallbacks makeMemoryCallbacks(MemoryAllocateCallback allocate, MemoryFreeCallback free, void *userData);
+
+struct MemoryTracker
+{
+    MemoryCallbacks callbacks;
+    size_t currentBytes = 0;
+    size_t peakBytes = 0;
+    size_t limitBytes = 0;
+
+    explicit MemoryTracker(const MemoryCallbacks &callbacks);
+
+    /**
+     * Returns null if the limit would be exceeded or the host callback fails.
+     */
+    void *allocate(size_t byteLength);
+    void deallocate(void *pointer, size_t byteLength);
+
+    /**
+     * Counts memory allocated elsewhere. Returns false without counting if the limit would be exceeded.
+     */
+    bool track(size_t byteLength);
+    void untrack(size_t byteLength);
+};
+
+/**
+ * Allocates and constructs an object through the given callbacks. The object must be constructible
+ * from MemoryCallbacks and have a MemoryTracker member named memory, which is charged for the object itself.
+ */
+template <class T>
+T *createTracked(const MemoryCallbacks &callbacks)
+{
+    void *storage = callbacks.allocate(sizeof(T), callbacks.userData);
+    if (storage == nullptr)
+    {
+        return nullptr;
+    }
+
+    try
+    {
+        T *object = new (storage) T(callbacks);
+        object->memory.track(sizeof(T));
+        return object;
+    }
+    catch (const std::bad_alloc &)
+    {
+        callbacks.free(storage, sizeof(T), callbacks.userData);
+        return nullptr;
+    }
+}
+
+template <class T>
+void releaseTracked(T *object)
+{
+    if (object == nullptr)
+    {
+        return;
+    }
+
+    MemoryCallbacks callbacks = object->memory.callbacks;
+    object->~T();
+    callbacks.free(object, sizeof(T), callbacks.userData);
+}
+
+template <class T>
+struct TrackedAllocator
+{
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    MemoryTracker *tracker;
+
+    explicit TrackedAllocator(MemoryTracker *tracker) : tracker(tracker) {}
+
+    template <class U>
+    TrackedAllocator(const TrackedAllocator<U> &other) : tracker(other.tracker) {}
+
+    T *allocate(size_t count)
+    {
+        void *pointer = tracker->allocate(count * sizeof(T));
+        if (pointer == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(pointer);
+    }
+
+    void deallocate(T *pointer, size_t count)
+    {
+        tracker->deallocate(pointer, count * sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const TrackedAllocator<T> &a, const TrackedAllocator<U> &b)
+{
+    return a.tracker == b.tracker;
+}
+
+template <class T, class U>
+bool operator!=(const TrackedAllocator<T> &a, const TrackedAllocator<U> &b)
+{
+    return a.tracker != b.tracker;
+}
+
+template <class T>
+using TrackedVector = std::vector<T, TrackedAllocator<T>>;
+
+template <class Key, class Value>
+using TrackedMap = std::map<Key, Value, std::less<Key>, TrackedAllocator<std::pair<const Key, Value>>>;
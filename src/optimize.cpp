@@ -0,0 +1,271 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "optimize.h"
+
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    const uint32_t kInvalidIndex = std::numeric_limits<uint32_t>::max();
+
+    const size_t kMinCacheSize = 4;
+    const size_t kMaxCacheSize = 64;
+    const float kCacheDecayPower = 1.5f;
+    const float kLastTriangleScore = 0.75f;
+    const float kValenceBoostScale = 2.0f;
+    const float kValenceBoostPower = 0.5f;
+
+    float getVertexScore(int cachePosition, uint32_t liveTriangles, size_t cacheSize)
+    {
+        if (liveTriangles == 0)
+        {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+            {
+                // The most recent triangle is scored the same regardless of the order of its vertices.
+                score = kLastTriangleScore;
+            }
+            else
+            {
+                float scaler = 1.0f / static_cast<float>(cacheSize - 3);
+                score = std::pow(1.0f - static_cast<float>(cachePosition - 3) * scaler, kCacheDecayPower);
+            }
+        }
+
+        score += kValenceBoostScale * std::pow(static_cast<float>(liveTriangles), -kValenceBoostPower);
+        return score;
+    }
+}
+
+float computeACMR(const TrackedVector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || cacheSize == 0)
+    {
+        return 0.0f;
+    }
+
+    // Timestamp of the point in time each vertex entered the FIFO cache.
+    TrackedVector<uint64_t> timestamps(vertexCount, 0, indices.get_allocator());
+    uint64_t time = static_cast<uint64_t>(cacheSize) + 1;
+    size_t misses = 0;
+
+    for (uint32_t index : indices)
+    {
+        if (index >= vertexCount)
+        {
+            continue;
+        }
+
+        if (time - timestamps[index] > cacheSize)
+        {
+            timestamps[index] = time++;
+            ++misses;
+        }
+    }
+
+    return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
+
+TrackedVector<uint32_t> optimizeVertexCache(const TrackedVector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize)
+{
+    size_t triangleCount = indices.size() / 3;
+    TrackedVector<uint32_t> result(indices.get_allocator());
+    result.reserve(triangleCount * 3);
+
+    size_t simulatedCacheSize = cacheSize < kMinCacheSize ? kMinCacheSize : (cacheSize > kMaxCacheSize ? kMaxCacheSize : cacheSize);
+
+    // Triangle adjacency per vertex, stored as offsets into a single array.
+    TrackedVector<uint32_t> liveTriangles(vertexCount, 0, indices.get_allocator());
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+    {
+        ++liveTriangles[indices[i]];
+    }
+
+    TrackedVector<uint32_t> adjacencyOffsets(vertexCount + 1, 0, indices.get_allocator());
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    }
+
+    TrackedVector<uint32_t> adjacency(triangleCount * 3, 0, indices.get_allocator());
+    TrackedVector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1, indices.get_allocator());
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        for (size_t k = 0; k < 3; ++k)
+        {
+            adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+        }
+    }
+
+    TrackedVector<int> cachePositions(vertexCount, -1, indices.get_allocator());
+    TrackedVector<float> vertexScores(vertexCount, 0.0f, indices.get_allocator());
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        vertexScores[v] = getVertexScore(-1, liveTriangles[v], simulatedCacheSize);
+    }
+
+    TrackedVector<float> triangleScores(triangleCount, 0.0f, indices.get_allocator());
+    TrackedVector<bool> emitted(triangleCount, false, indices.get_allocator());
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        const uint32_t *triangle = &indices[t * 3];
+        triangleScores[t] = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+    }
+
+    TrackedVector<uint32_t> cache(indices.get_allocator());
+    TrackedVector<uint32_t> nextCache(indices.get_allocator());
+    cache.reserve(simulatedCacheSize + 3);
+    nextCache.reserve(simulatedCacheSize + 3);
+
+    size_t cursor = 0;
+    uint32_t current = kInvalidIndex;
+
+    while (true)
+    {
+        if (current == kInvalidIndex)
+        {
+            // No live triangle touches the cache, continue with the next one in input order.
+            while (cursor < triangleCount && emitted[cursor])
+            {
+                ++cursor;
+            }
+            if (cursor == triangleCount)
+            {
+                break;
+            }
+            current = static_cast<uint32_t>(cursor);
+        }
+
+        const uint32_t *triangle = &indices[current * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[current] = true;
+
+        // Detach the emitted triangle from the adjacency of its vertices.
+        for (size_t k = 0; k < 3; ++k)
+        {
+            uint32_t v = triangle[k];
+            uint32_t *begin = &adjacency[adjacencyOffsets[v]];
+            uint32_t *end = begin + liveTriangles[v];
+            for (uint32_t *it = begin; it != end; ++it)
+            {
+                if (*it == current)
+                {
+                    *it = *(end - 1);
+                    --liveTriangles[v];
+                    break;
+                }
+            }
+        }
+
+        nextCache.assign(triangle, triangle + 3);
+        for (uint32_t v : cache)
+        {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+            {
+                nextCache.push_back(v);
+            }
+        }
+
+        // Vertices pushed out of the cache lose their position bonus.
+        for (size_t i = simulatedCacheSize; i < nextCache.size(); ++i)
+        {
+            uint32_t v = nextCache[i];
+            cachePositions[v] = -1;
+
+            float score = getVertexScore(-1, liveTriangles[v], simulatedCacheSize);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            for (uint32_t j = 0; j < liveTriangles[v]; ++j)
+            {
+                triangleScores[adjacency[adjacencyOffsets[v] + j]] += delta;
+            }
+        }
+        if (nextCache.size() > simulatedCacheSize)
+        {
+            nextCache.resize(simulatedCacheSize);
+        }
+
+        cache.swap(nextCache);
+
+        current = kInvalidIndex;
+        float bestScore = -std::numeric_limits<float>::max();
+
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            uint32_t v = cache[i];
+            cachePositions[v] = static_cast<int>(i);
+
+            float score = getVertexScore(cachePositions[v], liveTriangles[v], simulatedCacheSize);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+
+            for (uint32_t j = 0; j < liveTriangles[v]; ++j)
+            {
+                triangleScores[adjacency[adjacencyOffsets[v] + j]] += delta;
+            }
+        }
+
+        // Only triangles touching the cache are candidates, which keeps each step independent of mesh size.
+        for (uint32_t v : cache)
+        {
+            for (uint32_t j = 0; j < liveTriangles[v]; ++j)
+            {
+                uint32_t t = adjacency[adjacencyOffsets[v] + j];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    current = t;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+TrackedVector<uint32_t> optimizeVertexFetch(TrackedVector<uint32_t> &indices, size_t vertexCount)
+{
+    TrackedVector<uint32_t> remap(vertexCount, kInvalidIndex, indices.get_allocator());
+    TrackedVector<uint32_t> vertexOrder(indices.get_allocator());
+    vertexOrder.reserve(vertexCount);
+
+    for (uint32_t &index : indices)
+    {
+        if (remap[index] == kInvalidIndex)
+        {
+            remap[index] = static_cast<uint32_t>(vertexOrder.size());
+            vertexOrder.push_back(index);
+        }
+        index = remap[index];
+    }
+
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        if (remap[v] == kInvalidIndex)
+        {
+            vertexOrder.push_back(static_cast<uint32_t>(v));
+        }
+    }
+
+    return vertexOrder;
+}
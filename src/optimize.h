@@ -0,0 +1,40 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Index and vertex reordering applied to decoded meshes before they are handed to glTF-Blender-IO.
+ * Temporary buffers are allocated through the allocator of the given indices.
+ */
+
+#pragma once
+
+#include "memory.h"
+
+/**
+ * Average number of post-transform cache misses per triangle, simulated with a FIFO cache of the given size.
+ */
+float computeACMR(const TrackedVector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize);
+
+/**
+ * Reorders triangles for post-transform vertex cache locality (Tom Forsyth's linear-speed algorithm).
+ * The scoring simulates a cache of the given size, clamped to 4..64 entries. All indices must be below vertexCount.
+ */
+TrackedVector<uint32_t> optimizeVertexCache(const TrackedVector<uint32_t> &indices, size_t vertexCount, uint32_t cacheSize);
+
+/**
+ * Renumbers vertices in order of first use and rewrites the indices accordingly.
+ * Returns the new-to-old vertex mapping; unreferenced vertices are kept at the end.
+ * All indices must be below vertexCount.
+ */
+TrackedVector<uint32_t> optimizeVertexFetch(TrackedVector<uint32_t> &indices, size_t vertexCount);